@@ -86,7 +86,9 @@ typedef int (*_openhttp_write_callback)(openhttp_server_t *, const char *);
 int openhttp_server_spawn(openhttp_server_t *server, int port, _openhttp_write_callback callback);
 
 /**
- * Cleans up any resources allocated by the OpenHTTP library.
+ * Stops every running server, openhttp_server_spawn() then returns once its event loop has closed
+ * all connections (delivering the final OPENHTTP_WS_CLOSE callback to each WebSocket) and released
+ * its resources. Only requests the stop, so it is safe to call from a signal handler.
  *
  * Returns:
  * - OPENHTTP_SUCCESS if the cleanup was successful, unless an error occurred.
@@ -94,7 +96,7 @@ int openhttp_server_spawn(openhttp_server_t *server, int port, _openhttp_write_c
 int openhttp_cleanup();
 
 /**
- * Writes the provided data to the client.
+ * Writes the provided data to the client, must be called from the request callback.
  *
  * Returns:
  * - OPENHTTP_SUCCESS if the write was successful, unless an error occurred.
@@ -109,6 +111,248 @@ int openhttp_write(const char *data);
  */
 char *openhttp_generate_response(const char *code, const char *file_path);
 
+/**
+ * Admission control limits for the OpenHTTP event loop.
+ *
+ * Limits are shared by every event loop in the process and may be changed from any thread at any
+ * time, each loop enforces them against its own connections. A value of 0 disables the corresponding check.
+ *
+ * max_connections   : Maximum number of concurrently open client connections.
+ * max_inflight      : Maximum number of accepted HTTP connections still waiting for a response.
+ * rate_per_sec      : Sustained number of connections per second allowed for a single client IP.
+ * rate_burst        : Number of connections a single client IP may open in a burst.
+ * max_lag_us        : Event loop lag (in microseconds, see lag_us) above which new connections are shed,
+ *                     along with queued requests that have already waited longer than this.
+ * retry_after       : Value (in seconds) of the Retry-After header sent with a 503 response.
+ * header_timeout_ms : Time (in milliseconds) a client has after connecting to send its request headers,
+ *                     silent connections are closed once it runs out so they can't hold up the limits above.
+ */
+typedef struct openhttp_limits
+{
+    uint32_t max_connections;
+    uint32_t max_inflight;
+    uint32_t rate_per_sec;
+    uint32_t rate_burst;
+    uint32_t max_lag_us;
+    uint32_t retry_after;
+    uint32_t header_timeout_ms;
+} openhttp_limits_t;
+
+/**
+ * Admission control statistics for the OpenHTTP event loop.
+ *
+ * Called from an event loop thread they describe that loop, from any other thread they are the totals
+ * of all running loops, with the highest lag_us among them.
+ *
+ * connections   : Number of currently open client connections.
+ * inflight      : Number of accepted HTTP connections still waiting for a response.
+ * lag_us        : Event loop lag in microseconds, the lowest time a request waited between being accepted
+ *                 and being served over the last 100 ms.
+ * accepted      : Total number of accepted connections.
+ * shed_conns    : Total number of connections rejected by the max_connections limit.
+ * shed_inflight : Total number of connections rejected by the max_inflight limit.
+ * shed_rate     : Total number of connections rejected by the per-client rate limit.
+ * shed_lag      : Total number of connections rejected because of event loop lag.
+ * timed_out     : Total number of connections closed by the header_timeout_ms limit.
+ */
+typedef struct openhttp_stats
+{
+    uint32_t connections;
+    uint32_t inflight;
+    uint32_t lag_us;
+    uint64_t accepted;
+    uint64_t shed_conns;
+    uint64_t shed_inflight;
+    uint64_t shed_rate;
+    uint64_t shed_lag;
+    uint64_t timed_out;
+} openhttp_stats_t;
+
+/**
+ * Sets the admission control limits of all event loops.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the limits were applied, unless an error occurred.
+ */
+int openhttp_set_limits(const openhttp_limits_t *limits);
+
+/**
+ * Retrieves the admission control limits of all event loops.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the limits were retrieved, unless an error occurred.
+ */
+int openhttp_get_limits(openhttp_limits_t *limits);
+
+/**
+ * Retrieves the admission control statistics of the current event loop, or of all running loops.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the statistics were retrieved, unless no event loop is running or an error occurred.
+ */
+int openhttp_get_stats(openhttp_stats_t *stats);
+
+// ------------------------- END ------------------------------
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * WebSocket (RFC 6455) functions for the OpenHTTP library.
+ *
+ * Note: These functions are implemented in the websocket.c file.
+ * * * * * * * * *  * * * * * * * *  * * * * * * * *  * * * * * * */
+
+// ------------------------ BEGIN -----------------------------
+/*
+ * WebSocket frame opcodes.
+ */
+#define OPENHTTP_WS_CONTINUATION 0x0
+#define OPENHTTP_WS_TEXT 0x1
+#define OPENHTTP_WS_BINARY 0x2
+#define OPENHTTP_WS_CLOSE 0x8
+#define OPENHTTP_WS_PING 0x9
+#define OPENHTTP_WS_PONG 0xA
+
+/*
+ * WebSocket limits.
+ *
+ * OPENHTTP_WS_MAX_MESSAGE : Largest message (in bytes) accepted from a client.
+ * OPENHTTP_WS_MAX_QUEUE   : Frames that may be queued for a client before it is dropped as too slow.
+ */
+#define OPENHTTP_WS_MAX_MESSAGE (1 << 20)
+#define OPENHTTP_WS_MAX_QUEUE 1024
+
+/**
+ * An encoded, reference-counted WebSocket frame.
+ *
+ * A single frame can be queued on any number of connections, each of which holds a reference
+ * until the frame has been written out. The reference count is atomic, so a frame may be
+ * shared between event loops.
+ */
+typedef struct openhttp_ws_frame
+{
+    uint32_t _refcount;
+    size_t _length;
+    uint8_t _data[];
+} openhttp_ws_frame_t;
+
+/**
+ * An upgraded WebSocket connection.
+ *
+ * The user field is free for application use, all other fields are internal.
+ */
+typedef struct openhttp_ws
+{
+    int _fd;
+    int _closing;
+    int _dead;
+    int (*_callback)(struct openhttp_ws *, int opcode, const char *data, size_t length);
+
+    uint8_t *_rbuf;
+    size_t _rlen;
+    size_t _rcap;
+
+    uint8_t *_msg;
+    size_t _msg_len;
+    size_t _msg_cap;
+    int _msg_opcode;
+
+    openhttp_ws_frame_t **_out;
+    size_t _out_cap;
+    size_t _out_head;
+    size_t _out_count;
+    size_t _out_offset;
+
+    size_t _index;
+    void *user;
+} openhttp_ws_t;
+
+/**
+ * Callback function for handling incoming WebSocket messages.
+ *
+ * Fragmented messages are reassembled before the callback is invoked. When the connection
+ * goes away the callback is invoked one last time with OPENHTTP_WS_CLOSE and no data.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the message was handled successfully, unless an error occurred.
+ */
+typedef int (*_openhttp_ws_callback)(openhttp_ws_t *, int opcode, const char *data, size_t length);
+
+/**
+ * Upgrades the current client connection to a WebSocket, must be called from the request callback.
+ *
+ * The event loop only calls the request callback once the complete header block has arrived,
+ * requests with more than 16 KiB of headers are answered with 431 before they reach it.
+ *
+ * Returns:
+ * - The WebSocket connection, or NULL if the request is not a valid WebSocket handshake.
+ */
+openhttp_ws_t *openhttp_websocket_upgrade(const char *request, _openhttp_ws_callback callback);
+
+/**
+ * Sends a single message to a WebSocket connection.
+ *
+ * Note: Connections belong to their event loop, so this must be called from one of its callbacks.
+ * The same applies to openhttp_websocket_send_frame() and openhttp_websocket_close().
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the message was sent or queued, unless an error occurred.
+ */
+int openhttp_websocket_send(openhttp_ws_t *ws, int opcode, const char *data, size_t length);
+
+/**
+ * Encodes a message into a frame that can be sent to several connections.
+ *
+ * Returns:
+ * - The frame holding one reference, or NULL if an error occurred.
+ */
+openhttp_ws_frame_t *openhttp_websocket_frame(int opcode, const char *data, size_t length);
+
+/**
+ * Sends an encoded frame to a WebSocket connection, taking a reference while it is queued.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the frame was sent or queued, unless an error occurred.
+ */
+int openhttp_websocket_send_frame(openhttp_ws_t *ws, openhttp_ws_frame_t *frame);
+
+/**
+ * Drops a reference to a frame, freeing it once no connection holds it anymore.
+ */
+void openhttp_websocket_frame_release(openhttp_ws_frame_t *frame);
+
+/**
+ * Encodes a message once and sends it to every WebSocket connection.
+ *
+ * Called from a callback it sends to the connections of that event loop right away. Called from
+ * any other thread the frame is queued on every running event loop, which is woken up to send it.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the message was encoded and dispatched, unless an error occurred
+ *   or no event loop is running.
+ */
+int openhttp_websocket_broadcast(int opcode, const char *data, size_t length);
+
+/**
+ * Starts the closing handshake, the connection is closed once the close frame has been written.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the close frame was sent or queued, unless an error occurred.
+ */
+int openhttp_websocket_close(openhttp_ws_t *ws, uint16_t code);
+
+/**
+ * Parses received frames of a WebSocket connection and dispatches complete messages.
+ *
+ * Note: Called by the system specific event loop after reading from the connection.
+ *
+ * Returns:
+ * - The number of bytes consumed, any remainder is an incomplete frame.
+ */
+size_t _openhttp_ws_process(openhttp_ws_t *ws, uint8_t *data, size_t length);
+
+/**
+ * Unmasks a WebSocket payload in place.
+ */
+void _openhttp_ws_unmask(uint8_t *data, size_t length, const uint8_t mask[4]);
 // ------------------------- END ------------------------------
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -154,7 +398,7 @@ int OPENHTTP_SYSTEM_PREFIX(server_callback)(openhttp_server_t *, const char *);
 #endif // __linux__
 
 /**
- * Cleans up any resources allocated by the OpenHTTP library.
+ * Asks every running event loop to stop and release its resources, must be async-signal-safe.
  *
  * Returns:
  * - OPENHTTP_SUCCESS if the cleanup was successful, unless an error occurred.
@@ -169,6 +413,65 @@ int OPENHTTP_SYSTEM_PREFIX(cleanup)(void);
  */
 int OPENHTTP_SYSTEM_PREFIX(write_callback)(const char *);
 
+/**
+ * Sets the admission control limits of all event loops.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the limits were applied, unless an error occurred.
+ */
+int OPENHTTP_SYSTEM_PREFIX(set_limits)(const openhttp_limits_t *);
+
+/**
+ * Retrieves the admission control limits of all event loops.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the limits were retrieved, unless an error occurred.
+ */
+int OPENHTTP_SYSTEM_PREFIX(get_limits)(openhttp_limits_t *);
+
+/**
+ * Retrieves the admission control statistics of the current event loop, or of all running loops.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the statistics were retrieved, unless no event loop is running or an error occurred.
+ */
+int OPENHTTP_SYSTEM_PREFIX(get_stats)(openhttp_stats_t *);
+
+/**
+ * Takes a connection token from the rate limit bucket of a client address, at a monotonic time in microseconds.
+ *
+ * Note: Called by the event loop for every new connection, the explicit time lets the bucket be tested.
+ *
+ * Returns:
+ * - 1 if the connection is admitted, or 0 with the number of seconds until the next token stored in retry_after.
+ */
+int OPENHTTP_SYSTEM_PREFIX(rate_admit)(uint32_t, uint64_t, uint32_t *);
+
+/**
+ * Writes the handshake response and takes over the current client connection as a WebSocket.
+ *
+ * Returns:
+ * - The WebSocket connection, or NULL if an error occurred.
+ */
+openhttp_ws_t *OPENHTTP_SYSTEM_PREFIX(websocket_upgrade)(const char *, _openhttp_ws_callback);
+
+/**
+ * Writes or queues an encoded frame on a WebSocket connection.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the frame was sent or queued, unless an error occurred.
+ */
+int OPENHTTP_SYSTEM_PREFIX(websocket_send_frame)(openhttp_ws_t *, openhttp_ws_frame_t *);
+
+/**
+ * Queues an encoded frame on every WebSocket connection of the current event loop, or hands
+ * it to every running event loop when called from outside of one.
+ *
+ * Returns:
+ * - OPENHTTP_SUCCESS if the frame was dispatched, unless an error occurred.
+ */
+int OPENHTTP_SYSTEM_PREFIX(websocket_broadcast)(openhttp_ws_frame_t *);
+
 // ------------------------- END ------------------------------
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -14,6 +14,8 @@
  *  - Kevin Alavik <kevin@alavik.se>
  */
 
+#define _GNU_SOURCE
+
 #include <openhttp.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -47,19 +49,854 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #ifdef __linux__
 
 #define MAX_EVENTS 64
 
-static __thread int _linux_epoll_fd = -1;
-static __thread int _linux_listen_fd = -1;
+#define RATE_TABLE_BITS 10
+#define RATE_TABLE_SIZE (1 << RATE_TABLE_BITS)
+#define RATE_TABLE_PROBE 4
+#define RATE_TOKEN 1000000
+
+#define LAG_TICK_MS 100
+
+#define WS_READ_CHUNK 16384
+
+#define HTTP_MAX_REQUEST 16384
+
+typedef struct _linux_loop
+{
+    int wake_fd;
+    openhttp_stats_t stats;
+    openhttp_ws_frame_t **pending;
+    size_t pending_count;
+    size_t pending_cap;
+    struct _linux_loop *next;
+} _linux_loop_t;
+
+typedef struct _linux_http
+{
+    uint64_t accepted_us;
+    size_t index;
+    char *request;
+    size_t length;
+    size_t cap;
+} _linux_http_t;
+
+typedef struct _linux_rate_bucket
+{
+    uint32_t addr;
+    uint64_t tokens;
+    uint64_t stamp_us;
+} _linux_rate_bucket_t;
 
-static __thread int _linux_client_sockets[MAX_EVENTS] = {0};
-static __thread int _linux_client_count = 0;
+static __thread int _linux_epoll_fd = -1;
 
 static __thread int _linux_current_client_fd = -1;
 
+// Limits are shared by all loops and any thread may change them, while each loop keeps its own statistics
+// in the registry. Only the loop's own thread writes those, other threads read them with atomic loads.
+static openhttp_limits_t _linux_limits = {0, 0, 0, 0, 250000, 1, 10000};
+
+#define LIMIT(field) __atomic_load_n(&_linux_limits.field, __ATOMIC_RELAXED)
+#define STAT(field) (_linux_loop->stats.field)
+#define STAT_SET(field, value) __atomic_store_n(&_linux_loop->stats.field, (value), __ATOMIC_RELAXED)
+
+// Lowest time a request waited to be served during the current lag interval, and when that interval started.
+static __thread uint64_t _linux_lag_min = UINT64_MAX;
+static __thread uint64_t _linux_lag_start = 0;
+
+// When the connections were last checked against the header timeout.
+static __thread uint64_t _linux_expire_last = 0;
+
+// Per client IP token buckets, tokens are stored in millionths of a connection.
+static __thread _linux_rate_bucket_t _linux_rate_table[RATE_TABLE_SIZE];
+
+// HTTP connections waiting for their request to be served, indexed by file descriptor and packed into a list.
+static __thread _linux_http_t *_linux_http_by_fd = NULL;
+static __thread size_t _linux_http_by_fd_cap = 0;
+static __thread int *_linux_http_list = NULL;
+static __thread size_t _linux_http_count = 0;
+static __thread size_t _linux_http_cap = 0;
+
+// WebSocket connections, indexed by file descriptor for lookup and packed into a list for broadcasting.
+static __thread openhttp_ws_t **_linux_ws_by_fd = NULL;
+static __thread size_t _linux_ws_by_fd_cap = 0;
+static __thread openhttp_ws_t **_linux_ws_list = NULL;
+static __thread size_t _linux_ws_count = 0;
+static __thread size_t _linux_ws_cap = 0;
+static __thread size_t _linux_ws_dead = 0;
+
+// Running event loops, so broadcasts from other threads can be queued on them and wake them up.
+static pthread_mutex_t _linux_loops_lock = PTHREAD_MUTEX_INITIALIZER;
+static _linux_loop_t *_linux_loops = NULL;
+static __thread _linux_loop_t *_linux_loop = NULL;
+
+// Shared by all loops and never closed, so openhttp_cleanup() can stop them with a single write from a signal handler.
+static int _linux_stop_fd = -1;
+
+static uint64_t _linux_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static openhttp_ws_t *_linux_ws_lookup(int fd)
+{
+    return (size_t)fd < _linux_ws_by_fd_cap ? _linux_ws_by_fd[fd] : NULL;
+}
+
+static _linux_http_t *_linux_http_lookup(int fd)
+{
+    // The monotonic clock never reads 0 once the system is up, so a zero timestamp marks a free slot.
+    return (size_t)fd < _linux_http_by_fd_cap && _linux_http_by_fd[fd].accepted_us ? &_linux_http_by_fd[fd] : NULL;
+}
+
+static int _linux_http_open(int client_fd, uint64_t now)
+{
+    if ((size_t)client_fd >= _linux_http_by_fd_cap)
+    {
+        size_t cap = _linux_http_by_fd_cap ? _linux_http_by_fd_cap : 64;
+        while (cap <= (size_t)client_fd)
+            cap *= 2;
+
+        _linux_http_t *by_fd = (_linux_http_t *)realloc(_linux_http_by_fd, cap * sizeof(*by_fd));
+        if (!by_fd)
+        {
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for connection table");
+            return OPENHTTP_SYSTEM_ERROR;
+        }
+        memset(by_fd + _linux_http_by_fd_cap, 0, (cap - _linux_http_by_fd_cap) * sizeof(*by_fd));
+        _linux_http_by_fd = by_fd;
+        _linux_http_by_fd_cap = cap;
+    }
+
+    if (_linux_http_count == _linux_http_cap)
+    {
+        size_t cap = _linux_http_cap ? _linux_http_cap * 2 : 64;
+        int *list = (int *)realloc(_linux_http_list, cap * sizeof(*list));
+        if (!list)
+        {
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for connection table");
+            return OPENHTTP_SYSTEM_ERROR;
+        }
+        _linux_http_list = list;
+        _linux_http_cap = cap;
+    }
+
+    _linux_http_by_fd[client_fd].accepted_us = now;
+    _linux_http_by_fd[client_fd].index = _linux_http_count;
+    _linux_http_list[_linux_http_count++] = client_fd;
+    STAT_SET(inflight, _linux_http_count);
+    return OPENHTTP_SUCCESS;
+}
+
+// Called once a connection got its response or was upgraded, it no longer counts as in-flight.
+static void _linux_http_remove(int client_fd)
+{
+    _linux_http_t *http = &_linux_http_by_fd[client_fd];
+    _linux_http_list[http->index] = _linux_http_list[--_linux_http_count];
+    _linux_http_by_fd[_linux_http_list[http->index]].index = http->index;
+    http->accepted_us = 0;
+
+    free(http->request);
+    http->request = NULL;
+    http->length = 0;
+    http->cap = 0;
+    STAT_SET(inflight, _linux_http_count);
+}
+
+static void _linux_close_client(int client_fd)
+{
+    if (STAT(connections) > 0)
+    {
+        STAT_SET(connections, STAT(connections) - 1);
+    }
+
+    if (_linux_http_lookup(client_fd))
+    {
+        _linux_http_remove(client_fd);
+    }
+
+    close(client_fd);
+}
+
+static void _linux_shed_client(int client_fd, uint32_t retry_after)
+{
+    char response[128];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 503 Service Unavailable\r\n"
+                          "Retry-After: %u\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n"
+                          "\r\n",
+                          retry_after);
+
+    // Best effort, the client is dropped regardless of whether the response made it out.
+    send(client_fd, response, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+int _openhttp_linux_rate_admit(uint32_t addr, uint64_t now, uint32_t *retry_after)
+{
+    uint64_t rate = LIMIT(rate_per_sec);
+    uint64_t burst = LIMIT(rate_burst);
+    burst = (burst ? burst : rate) * RATE_TOKEN;
+    if (!rate)
+    {
+        return 1;
+    }
+
+    uint32_t hash = (addr * 2654435761u) >> (32 - RATE_TABLE_BITS);
+    _linux_rate_bucket_t *bucket = NULL;
+    _linux_rate_bucket_t *oldest = NULL;
+
+    for (int i = 0; i < RATE_TABLE_PROBE; i++)
+    {
+        _linux_rate_bucket_t *slot = &_linux_rate_table[(hash + i) & (RATE_TABLE_SIZE - 1)];
+        if (slot->stamp_us != 0 && slot->addr == addr)
+        {
+            bucket = slot;
+            break;
+        }
+
+        if (!oldest || slot->stamp_us < oldest->stamp_us)
+        {
+            oldest = slot;
+        }
+    }
+
+    if (!bucket)
+    {
+        // The table is fixed in size, so the least recently seen client in the probe window is evicted.
+        bucket = oldest;
+        bucket->addr = addr;
+        bucket->tokens = burst;
+    }
+    else
+    {
+        // A token is a millionth of a connection, so every elapsed microsecond adds exactly rate tokens.
+        uint64_t elapsed = now - bucket->stamp_us;
+        uint64_t missing = bucket->tokens < burst ? burst - bucket->tokens : 0;
+        bucket->tokens = elapsed >= missing / rate + 1 ? burst : bucket->tokens + elapsed * rate;
+    }
+    bucket->stamp_us = now;
+
+    if (bucket->tokens >= RATE_TOKEN)
+    {
+        bucket->tokens -= RATE_TOKEN;
+        return 1;
+    }
+
+    uint64_t wait_us = (RATE_TOKEN - bucket->tokens + rate - 1) / rate;
+    *retry_after = (uint32_t)((wait_us + 999999) / 1000000);
+    return 0;
+}
+
+static int _linux_admit(uint32_t addr, uint32_t *retry_after)
+{
+    uint32_t max_connections = LIMIT(max_connections);
+    if (max_connections && STAT(connections) >= max_connections)
+    {
+        STAT_SET(shed_conns, STAT(shed_conns) + 1);
+        return 0;
+    }
+
+    uint32_t max_inflight = LIMIT(max_inflight);
+    if (max_inflight && STAT(inflight) >= max_inflight)
+    {
+        STAT_SET(shed_inflight, STAT(shed_inflight) + 1);
+        return 0;
+    }
+
+    uint32_t max_lag = LIMIT(max_lag_us);
+    if (max_lag && STAT(lag_us) > max_lag)
+    {
+        STAT_SET(shed_lag, STAT(shed_lag) + 1);
+        return 0;
+    }
+
+    if (LIMIT(rate_per_sec) && !_openhttp_linux_rate_admit(addr, _linux_now_us(), retry_after))
+    {
+        STAT_SET(shed_rate, STAT(shed_rate) + 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Lag is the lowest time a request waited to be served over an interval. Bursts and slow clients only
+// raise single samples, a minimum that stays high means a standing queue the loop can't keep up with.
+static void _linux_lag_sample(uint64_t wait, uint64_t now)
+{
+    if (_linux_lag_min == UINT64_MAX)
+    {
+        _linux_lag_start = now;
+    }
+
+    if (wait < _linux_lag_min)
+    {
+        _linux_lag_min = wait;
+    }
+}
+
+static void _linux_lag_update(uint64_t now)
+{
+    if (now - _linux_lag_start < LAG_TICK_MS * 1000)
+    {
+        return;
+    }
+
+    if (_linux_lag_min == UINT64_MAX)
+    {
+        STAT_SET(lag_us, 0);
+    }
+    else
+    {
+        STAT_SET(lag_us, _linux_lag_min > UINT32_MAX ? UINT32_MAX : (uint32_t)_linux_lag_min);
+    }
+
+    _linux_lag_min = UINT64_MAX;
+    _linux_lag_start = now;
+}
+
+// Closes connections that haven't sent their request in time, so silent clients can't fill the limits.
+static void _linux_http_expire(uint64_t now)
+{
+    uint64_t timeout = (uint64_t)LIMIT(header_timeout_ms) * 1000;
+    if (!timeout || now - _linux_expire_last < LAG_TICK_MS * 1000)
+    {
+        return;
+    }
+    _linux_expire_last = now;
+
+    // Removal moves the last connection into the freed slot, walking backwards it has already been checked.
+    for (size_t i = _linux_http_count; i-- > 0;)
+    {
+        int client_fd = _linux_http_list[i];
+        if (now - _linux_http_by_fd[client_fd].accepted_us > timeout)
+        {
+            STAT_SET(timed_out, STAT(timed_out) + 1);
+            _linux_close_client(client_fd);
+        }
+    }
+}
+
+// Returns 1 if connections may still be waiting in the backlog.
+static int _linux_accept(int epoll_fd, int listen_fd)
+{
+    uint32_t max_lag = LIMIT(max_lag_us);
+
+    for (int count = 0;; count++)
+    {
+        // Everything accepted while lagging is shed, so the backlog is drained a batch per iteration
+        // instead of holding up the requests already queued on the loop.
+        if (count == MAX_EVENTS && max_lag && STAT(lag_us) > max_lag)
+        {
+            return 1;
+        }
+
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_addr_len);
+        if (client_fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Failed to accept client connection");
+            }
+            return 0;
+        }
+
+        fcntl(client_fd, F_SETFL, O_NONBLOCK);
+
+        uint32_t retry_after = LIMIT(retry_after);
+        if (!_linux_admit(client_addr.sin_addr.s_addr, &retry_after))
+        {
+            _linux_shed_client(client_fd, retry_after);
+            close(client_fd);
+            continue;
+        }
+
+        if (_linux_http_open(client_fd, _linux_now_us()) != OPENHTTP_SUCCESS)
+        {
+            close(client_fd);
+            continue;
+        }
+
+        STAT_SET(accepted, STAT(accepted) + 1);
+        STAT_SET(connections, STAT(connections) + 1);
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = client_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1)
+        {
+            _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Failed to add client socket to epoll instance");
+            _linux_close_client(client_fd);
+        }
+    }
+}
+
+static void _linux_http_serve(openhttp_server_t *server, int client_fd, const char *request,
+                              _openhttp_client_handler_t client_handler)
+{
+    uint64_t now = _linux_now_us();
+    uint64_t wait = now - _linux_http_by_fd[client_fd].accepted_us;
+    _linux_lag_sample(wait, now);
+
+    // Like CoDel, requests are only dropped while the queue is standing, and only those that waited too long themselves.
+    uint32_t max_lag = LIMIT(max_lag_us);
+    if (max_lag && STAT(lag_us) > max_lag && wait > max_lag)
+    {
+        STAT_SET(shed_lag, STAT(shed_lag) + 1);
+        _linux_shed_client(client_fd, LIMIT(retry_after));
+        _linux_close_client(client_fd);
+        return;
+    }
+
+    // Only valid while the handler runs, WebSocket callbacks must not write raw HTTP.
+    _linux_current_client_fd = client_fd;
+    client_handler(server, client_fd, request);
+    _linux_current_client_fd = -1;
+
+    // Upgraded connections stay open on the loop.
+    if (_linux_ws_lookup(client_fd))
+    {
+        _linux_http_remove(client_fd);
+    }
+    else
+    {
+        _linux_close_client(client_fd);
+    }
+}
+
+// The handler is only called once the complete header block has arrived, requests split over several
+// reads are buffered on the connection until then.
+static void _linux_http_read(openhttp_server_t *server, int client_fd, _openhttp_client_handler_t client_handler)
+{
+    _linux_http_t *http = &_linux_http_by_fd[client_fd];
+    char chunk[HTTP_MAX_REQUEST + 1];
+
+    while (1)
+    {
+        ssize_t bytes_read = read(client_fd, chunk, HTTP_MAX_REQUEST - http->length);
+        if (bytes_read == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Failed to read from client socket");
+                _linux_close_client(client_fd);
+            }
+            return;
+        }
+        else if (bytes_read == 0)
+        {
+            _linux_close_client(client_fd);
+            return;
+        }
+
+        // Most requests arrive in one piece and are served straight from the stack.
+        if (http->length == 0 && memmem(chunk, bytes_read, "\r\n\r\n", 4))
+        {
+            chunk[bytes_read] = '\0';
+            _linux_http_serve(server, client_fd, chunk, client_handler);
+            return;
+        }
+
+        size_t length = http->length + bytes_read;
+        if (length + 1 > http->cap)
+        {
+            size_t cap = http->cap ? http->cap * 2 : 1024;
+            while (cap < length + 1)
+                cap *= 2;
+            if (cap > HTTP_MAX_REQUEST + 1)
+                cap = HTTP_MAX_REQUEST + 1;
+
+            char *request = (char *)realloc(http->request, cap);
+            if (!request)
+            {
+                _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for request buffer");
+                _linux_close_client(client_fd);
+                return;
+            }
+            http->request = request;
+            http->cap = cap;
+        }
+
+        // The blank line may straddle the previous read.
+        size_t scan = http->length > 3 ? http->length - 3 : 0;
+        memcpy(http->request + http->length, chunk, bytes_read);
+        http->length = length;
+
+        if (memmem(http->request + scan, length - scan, "\r\n\r\n", 4))
+        {
+            http->request[length] = '\0';
+            _linux_http_serve(server, client_fd, http->request, client_handler);
+            return;
+        }
+
+        if (length == HTTP_MAX_REQUEST)
+        {
+            static const char response[] = "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                                           "Content-Length: 0\r\n"
+                                           "Connection: close\r\n"
+                                           "\r\n";
+
+            send(client_fd, response, sizeof(response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            _linux_close_client(client_fd);
+            return;
+        }
+    }
+}
+
+// Connections are only marked here and released at the end of the loop iteration,
+// so callbacks and broadcasts never see a connection disappear under them.
+static void _linux_ws_kill(openhttp_ws_t *ws)
+{
+    if (!ws->_dead)
+    {
+        ws->_dead = 1;
+        _linux_ws_dead++;
+    }
+}
+
+static void _linux_ws_free(openhttp_ws_t *ws)
+{
+    _linux_close_client(ws->_fd);
+    _linux_ws_by_fd[ws->_fd] = NULL;
+    _linux_ws_list[ws->_index] = _linux_ws_list[--_linux_ws_count];
+    _linux_ws_list[ws->_index]->_index = ws->_index;
+
+    for (; ws->_out_count > 0; ws->_out_count--)
+    {
+        openhttp_websocket_frame_release(ws->_out[ws->_out_head]);
+        ws->_out_head = (ws->_out_head + 1) % ws->_out_cap;
+    }
+
+    free(ws->_out);
+    free(ws->_rbuf);
+    free(ws->_msg);
+    free(ws);
+}
+
+static void _linux_ws_reap(void)
+{
+    while (_linux_ws_dead > 0)
+    {
+        for (size_t i = _linux_ws_count; i-- > 0;)
+        {
+            openhttp_ws_t *ws = _linux_ws_list[i];
+            if (!ws->_dead)
+                continue;
+
+            _linux_ws_dead--;
+            ws->_callback(ws, OPENHTTP_WS_CLOSE, NULL, 0);
+            _linux_ws_free(ws);
+        }
+    }
+}
+
+static void _linux_ws_flush(openhttp_ws_t *ws)
+{
+    while (ws->_out_count > 0)
+    {
+        openhttp_ws_frame_t *frame = ws->_out[ws->_out_head];
+        ssize_t sent = send(ws->_fd, frame->_data + ws->_out_offset, frame->_length - ws->_out_offset, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                _linux_ws_kill(ws);
+            }
+            return;
+        }
+
+        ws->_out_offset += sent;
+        if (ws->_out_offset < frame->_length)
+        {
+            return;
+        }
+
+        openhttp_websocket_frame_release(frame);
+        ws->_out_head = (ws->_out_head + 1) % ws->_out_cap;
+        ws->_out_count--;
+        ws->_out_offset = 0;
+    }
+
+    if (ws->_closing)
+    {
+        _linux_ws_kill(ws);
+    }
+}
+
+static void _linux_ws_read(openhttp_ws_t *ws)
+{
+    uint8_t chunk[WS_READ_CHUNK];
+
+    while (!ws->_dead && !ws->_closing)
+    {
+        ssize_t bytes_read = read(ws->_fd, chunk, sizeof(chunk));
+        if (bytes_read == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                _linux_ws_kill(ws);
+            }
+            break;
+        }
+        else if (bytes_read == 0)
+        {
+            _linux_ws_kill(ws);
+            break;
+        }
+
+        uint8_t *data = chunk;
+        size_t length = bytes_read;
+
+        // Frames are parsed straight from the stack, only a trailing partial frame is kept per connection.
+        if (ws->_rlen > 0)
+        {
+            if (ws->_rlen + length > ws->_rcap)
+            {
+                size_t cap = ws->_rcap * 2 > ws->_rlen + length ? ws->_rcap * 2 : ws->_rlen + length;
+                uint8_t *rbuf = (uint8_t *)realloc(ws->_rbuf, cap);
+                if (!rbuf)
+                {
+                    _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket buffer");
+                    _linux_ws_kill(ws);
+                    break;
+                }
+                ws->_rbuf = rbuf;
+                ws->_rcap = cap;
+            }
+
+            memcpy(ws->_rbuf + ws->_rlen, chunk, length);
+            ws->_rlen += length;
+            data = ws->_rbuf;
+            length = ws->_rlen;
+        }
+
+        size_t consumed = _openhttp_ws_process(ws, data, length);
+        size_t remaining = length - consumed;
+
+        if (remaining == 0)
+        {
+            // Partial frames are rare, so idle connections hand their buffer back instead of keeping it.
+            free(ws->_rbuf);
+            ws->_rbuf = NULL;
+            ws->_rlen = 0;
+            ws->_rcap = 0;
+        }
+        else if (data == ws->_rbuf)
+        {
+            memmove(ws->_rbuf, ws->_rbuf + consumed, remaining);
+            ws->_rlen = remaining;
+        }
+        else
+        {
+            if (remaining > ws->_rcap)
+            {
+                uint8_t *rbuf = (uint8_t *)realloc(ws->_rbuf, remaining);
+                if (!rbuf)
+                {
+                    _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket buffer");
+                    _linux_ws_kill(ws);
+                    break;
+                }
+                ws->_rbuf = rbuf;
+                ws->_rcap = remaining;
+            }
+
+            memcpy(ws->_rbuf, chunk + consumed, remaining);
+            ws->_rlen = remaining;
+        }
+    }
+}
+
+static void _linux_ws_event(openhttp_ws_t *ws, uint32_t events)
+{
+    if (ws->_dead)
+    {
+        return;
+    }
+
+    if (events & EPOLLOUT)
+    {
+        _linux_ws_flush(ws);
+    }
+
+    if (events & EPOLLIN)
+    {
+        _linux_ws_read(ws);
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        _linux_ws_kill(ws);
+    }
+}
+
+static int _linux_loop_register(int epoll_fd)
+{
+    _linux_loop_t *loop = (_linux_loop_t *)calloc(1, sizeof(_linux_loop_t));
+    if (!loop)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for event loop");
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd == -1)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to create event loop wakeup descriptor");
+        free(loop);
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = loop->wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) == -1)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to add wakeup descriptor to epoll instance");
+        close(loop->wake_fd);
+        free(loop);
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    pthread_mutex_lock(&_linux_loops_lock);
+    if (_linux_stop_fd == -1)
+    {
+        __atomic_store_n(&_linux_stop_fd, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), __ATOMIC_RELEASE);
+    }
+    else if (!_linux_loops)
+    {
+        // A stop requested while no loop was running doesn't apply to this one.
+        uint64_t value;
+        if (read(_linux_stop_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        {
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to read from stop descriptor");
+        }
+    }
+    int stop_fd = _linux_stop_fd;
+    pthread_mutex_unlock(&_linux_loops_lock);
+
+    // Level-triggered, so every loop sees the stop request.
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd;
+    if (stop_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) == -1)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to add stop descriptor to epoll instance");
+        close(loop->wake_fd);
+        free(loop);
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    pthread_mutex_lock(&_linux_loops_lock);
+    loop->next = _linux_loops;
+    _linux_loops = loop;
+    pthread_mutex_unlock(&_linux_loops_lock);
+
+    _linux_loop = loop;
+    return OPENHTTP_SUCCESS;
+}
+
+static void _linux_loop_unregister(void)
+{
+    _linux_loop_t *loop = _linux_loop;
+    if (!loop)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&_linux_loops_lock);
+    for (_linux_loop_t **link = &_linux_loops; *link; link = &(*link)->next)
+    {
+        if (*link == loop)
+        {
+            *link = loop->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_linux_loops_lock);
+
+    for (size_t i = 0; i < loop->pending_count; i++)
+    {
+        openhttp_websocket_frame_release(loop->pending[i]);
+    }
+
+    close(loop->wake_fd);
+    free(loop->pending);
+    free(loop);
+    _linux_loop = NULL;
+}
+
+// Sends out the broadcasts other threads have queued on this loop.
+static void _linux_loop_drain(void)
+{
+    uint64_t value;
+    if (read(_linux_loop->wake_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to read from wakeup descriptor");
+    }
+
+    pthread_mutex_lock(&_linux_loops_lock);
+    openhttp_ws_frame_t **pending = _linux_loop->pending;
+    size_t pending_count = _linux_loop->pending_count;
+    _linux_loop->pending = NULL;
+    _linux_loop->pending_count = 0;
+    _linux_loop->pending_cap = 0;
+    pthread_mutex_unlock(&_linux_loops_lock);
+
+    for (size_t i = 0; i < pending_count; i++)
+    {
+        _openhttp_linux_websocket_broadcast(pending[i]);
+        openhttp_websocket_frame_release(pending[i]);
+    }
+
+    free(pending);
+}
+
+// Releases everything the loop owns once it stops. WebSockets are sent a going away close frame where
+// possible and get their final close callback like any other closed connection.
+static void _linux_shutdown(void)
+{
+    for (size_t i = 0; i < _linux_ws_count; i++)
+    {
+        openhttp_websocket_close(_linux_ws_list[i], 1001);
+        _linux_ws_kill(_linux_ws_list[i]);
+    }
+    _linux_ws_reap();
+
+    free(_linux_ws_list);
+    free(_linux_ws_by_fd);
+    _linux_ws_list = NULL;
+    _linux_ws_by_fd = NULL;
+    _linux_ws_cap = 0;
+    _linux_ws_by_fd_cap = 0;
+
+    while (_linux_http_count > 0)
+    {
+        _linux_close_client(_linux_http_list[_linux_http_count - 1]);
+    }
+    free(_linux_http_list);
+    free(_linux_http_by_fd);
+    _linux_http_list = NULL;
+    _linux_http_by_fd = NULL;
+    _linux_http_cap = 0;
+    _linux_http_by_fd_cap = 0;
+
+    _linux_lag_min = UINT64_MAX;
+
+    // Closing the connections above still updates the loop statistics, so the loop goes last.
+    _linux_loop_unregister();
+}
+
 int _openhttp_linux_server_spawn(openhttp_server_t *server, int _port, _openhttp_client_handler_t client_handler)
 {
     int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
@@ -69,6 +906,10 @@ int _openhttp_linux_server_spawn(openhttp_server_t *server, int _port, _openhttp
         return OPENHTTP_UNKNOWN_ERROR;
     }
 
+    // Lets the server restart while connections from a previous run are still in TIME_WAIT.
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     struct sockaddr_in server_addr = {0};
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
@@ -88,8 +929,6 @@ int _openhttp_linux_server_spawn(openhttp_server_t *server, int _port, _openhttp
         return OPENHTTP_UNKNOWN_ERROR;
     }
 
-    _linux_listen_fd = listen_fd;
-
     int epoll_fd = epoll_create1(0);
     if (epoll_fd == -1)
     {
@@ -111,13 +950,40 @@ int _openhttp_linux_server_spawn(openhttp_server_t *server, int _port, _openhttp
         return OPENHTTP_UNKNOWN_ERROR;
     }
 
+    if (_linux_loop_register(epoll_fd) != OPENHTTP_SUCCESS)
+    {
+        close(listen_fd);
+        close(epoll_fd);
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
     struct epoll_event events[MAX_EVENTS];
+    int accept_pending = 0;
+    int running = 1;
 
-    while (1)
+    while (running)
     {
-        int nfd = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        // Lag intervals and header timeouts are only checked on a wakeup, so the loop wakes up
+        // periodically while either could be pending.
+        int timeout = -1;
+        if (accept_pending)
+        {
+            timeout = 0;
+        }
+        else if (STAT(lag_us) || _linux_lag_min != UINT64_MAX || _linux_http_count > 0)
+        {
+            timeout = LAG_TICK_MS;
+        }
+
+        int nfd = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
         if (nfd == -1)
         {
+            // A signal handler ran, if it called openhttp_cleanup() the stop descriptor is ready now.
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
             _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "epoll_wait failed");
             break;
         }
@@ -126,104 +992,353 @@ int _openhttp_linux_server_spawn(openhttp_server_t *server, int _port, _openhttp
         {
             if (events[i].data.fd == listen_fd)
             {
-                struct sockaddr_in client_addr;
-                socklen_t client_addr_len = sizeof(client_addr);
-                int client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-                if (client_fd == -1)
-                {
-                    _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Failed to accept client connection");
-                    continue;
-                }
-
-                fcntl(client_fd, F_SETFL, O_NONBLOCK);
-
-                if (_linux_client_count < MAX_EVENTS)
-                {
-                    _linux_client_sockets[_linux_client_count++] = client_fd;
-                }
-
-                event.events = EPOLLIN | EPOLLET;
-                event.data.fd = client_fd;
-                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1)
-                {
-                    _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Failed to add client socket to epoll instance");
-                    close(client_fd);
-                    continue;
-                }
+                accept_pending = 1;
             }
-            else if (events[i].events & EPOLLIN)
+            else if (events[i].data.fd == _linux_stop_fd)
             {
-                int client_fd = events[i].data.fd;
-                _linux_current_client_fd = client_fd;
-                char buffer[1024];
-                ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read == -1)
-                {
-                    if (errno != EAGAIN)
-                    {
-                        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Failed to read from client socket");
-                        close(client_fd);
-                    }
-                }
-                else if (bytes_read == 0)
-                {
-                    close(client_fd);
-                }
-                else
-                {
-                    buffer[bytes_read] = '\0';
-                    client_handler(server, client_fd, buffer);
-                    close(client_fd);
-                }
+                running = 0;
+            }
+            else if (_linux_loop && events[i].data.fd == _linux_loop->wake_fd)
+            {
+                _linux_loop_drain();
+            }
+            else if (_linux_ws_lookup(events[i].data.fd))
+            {
+                _linux_ws_event(_linux_ws_lookup(events[i].data.fd), events[i].events);
+            }
+            else if (_linux_http_lookup(events[i].data.fd))
+            {
+                _linux_http_read(server, events[i].data.fd, client_handler);
             }
         }
+
+        // Accepting after the ready connections are served keeps a large backlog from delaying them.
+        if (accept_pending)
+        {
+            accept_pending = _linux_accept(epoll_fd, listen_fd);
+        }
+
+        _linux_ws_reap();
+
+        uint64_t now = _linux_now_us();
+        _linux_lag_update(now);
+        _linux_http_expire(now);
     }
 
+    _linux_shutdown();
     close(listen_fd);
     close(epoll_fd);
+    _linux_epoll_fd = -1;
     return OPENHTTP_SUCCESS;
 }
 
 int _openhttp_linux_cleanup()
 {
-    for (int i = 0; i < _linux_client_count; i++)
+    // Only async-signal-safe calls here, the loops release their resources themselves once they see the request.
+    int saved_errno = errno;
+    int stop_fd = __atomic_load_n(&_linux_stop_fd, __ATOMIC_ACQUIRE);
+    if (stop_fd != -1)
     {
-        close(_linux_client_sockets[i]);
+        // Can only fail once the counter is saturated, when a stop is pending anyway.
+        uint64_t one = 1;
+        ssize_t written = write(stop_fd, &one, sizeof(one));
+        (void)written;
     }
-    _linux_client_count = 0;
+    errno = saved_errno;
+
+    return OPENHTTP_SUCCESS;
+}
+
+int _openhttp_linux_server_callback(openhttp_server_t *server, int client_fd, const char *request)
+{
+    server->_callback(server, request);
+    return OPENHTTP_SUCCESS;
+}
 
-    if (_linux_epoll_fd != -1)
+int _openhttp_linux_write_callback(const char *data)
+{
+    if (_linux_current_client_fd == -1)
     {
-        close(_linux_epoll_fd);
-        _linux_epoll_fd = -1;
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "No client connection to write to");
+        return OPENHTTP_UNKNOWN_ERROR;
     }
 
-    if (_linux_listen_fd != -1)
+    if (write(_linux_current_client_fd, data, strlen(data)) == -1)
     {
-        close(_linux_listen_fd);
-        _linux_listen_fd = -1;
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to write response to client socket");
+        return OPENHTTP_SYSTEM_ERROR;
     }
 
     return OPENHTTP_SUCCESS;
 }
 
-int _openhttp_linux_server_callback(openhttp_server_t *server, int client_fd, const char *request)
+int _openhttp_linux_set_limits(const openhttp_limits_t *limits)
 {
-    server->_callback(server, request);
+    // Each field is stored on its own, a loop may briefly see a mix of the old and new limits.
+    __atomic_store_n(&_linux_limits.max_connections, limits->max_connections, __ATOMIC_RELAXED);
+    __atomic_store_n(&_linux_limits.max_inflight, limits->max_inflight, __ATOMIC_RELAXED);
+    __atomic_store_n(&_linux_limits.rate_per_sec, limits->rate_per_sec, __ATOMIC_RELAXED);
+    __atomic_store_n(&_linux_limits.rate_burst, limits->rate_burst, __ATOMIC_RELAXED);
+    __atomic_store_n(&_linux_limits.max_lag_us, limits->max_lag_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&_linux_limits.retry_after, limits->retry_after, __ATOMIC_RELAXED);
+    __atomic_store_n(&_linux_limits.header_timeout_ms, limits->header_timeout_ms, __ATOMIC_RELAXED);
     return OPENHTTP_SUCCESS;
 }
 
-int _openhttp_linux_write_callback(const char *data)
+int _openhttp_linux_get_limits(openhttp_limits_t *limits)
 {
-    if (write(_linux_current_client_fd, data, strlen(data)) == -1)
+    limits->max_connections = LIMIT(max_connections);
+    limits->max_inflight = LIMIT(max_inflight);
+    limits->rate_per_sec = LIMIT(rate_per_sec);
+    limits->rate_burst = LIMIT(rate_burst);
+    limits->max_lag_us = LIMIT(max_lag_us);
+    limits->retry_after = LIMIT(retry_after);
+    limits->header_timeout_ms = LIMIT(header_timeout_ms);
+    return OPENHTTP_SUCCESS;
+}
+
+// Adds the statistics of a loop to a total, lag is the highest of the loops rather than a sum.
+static void _linux_stats_add(openhttp_stats_t *total, openhttp_stats_t *stats)
+{
+    uint32_t lag_us = __atomic_load_n(&stats->lag_us, __ATOMIC_RELAXED);
+
+    total->connections += __atomic_load_n(&stats->connections, __ATOMIC_RELAXED);
+    total->inflight += __atomic_load_n(&stats->inflight, __ATOMIC_RELAXED);
+    total->lag_us = lag_us > total->lag_us ? lag_us : total->lag_us;
+    total->accepted += __atomic_load_n(&stats->accepted, __ATOMIC_RELAXED);
+    total->shed_conns += __atomic_load_n(&stats->shed_conns, __ATOMIC_RELAXED);
+    total->shed_inflight += __atomic_load_n(&stats->shed_inflight, __ATOMIC_RELAXED);
+    total->shed_rate += __atomic_load_n(&stats->shed_rate, __ATOMIC_RELAXED);
+    total->shed_lag += __atomic_load_n(&stats->shed_lag, __ATOMIC_RELAXED);
+    total->timed_out += __atomic_load_n(&stats->timed_out, __ATOMIC_RELAXED);
+}
+
+int _openhttp_linux_get_stats(openhttp_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if (_linux_loop)
     {
-        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to write response to client socket");
+        _linux_stats_add(stats, &_linux_loop->stats);
+        return OPENHTTP_SUCCESS;
+    }
+
+    // Off the loop threads the statistics of every running loop are added up.
+    pthread_mutex_lock(&_linux_loops_lock);
+    if (!_linux_loops)
+    {
+        pthread_mutex_unlock(&_linux_loops_lock);
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "No event loop is running to get statistics from");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    for (_linux_loop_t *loop = _linux_loops; loop; loop = loop->next)
+    {
+        _linux_stats_add(stats, &loop->stats);
+    }
+    pthread_mutex_unlock(&_linux_loops_lock);
+
+    return OPENHTTP_SUCCESS;
+}
+
+openhttp_ws_t *_openhttp_linux_websocket_upgrade(const char *response, _openhttp_ws_callback callback)
+{
+    int client_fd = _linux_current_client_fd;
+    if (client_fd < 0 || _linux_ws_lookup(client_fd))
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "No client connection to upgrade");
+        return NULL;
+    }
+
+    if ((size_t)client_fd >= _linux_ws_by_fd_cap)
+    {
+        size_t cap = _linux_ws_by_fd_cap ? _linux_ws_by_fd_cap : 64;
+        while (cap <= (size_t)client_fd)
+            cap *= 2;
+
+        openhttp_ws_t **by_fd = (openhttp_ws_t **)realloc(_linux_ws_by_fd, cap * sizeof(*by_fd));
+        if (!by_fd)
+        {
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket table");
+            return NULL;
+        }
+        memset(by_fd + _linux_ws_by_fd_cap, 0, (cap - _linux_ws_by_fd_cap) * sizeof(*by_fd));
+        _linux_ws_by_fd = by_fd;
+        _linux_ws_by_fd_cap = cap;
+    }
+
+    if (_linux_ws_count == _linux_ws_cap)
+    {
+        size_t cap = _linux_ws_cap ? _linux_ws_cap * 2 : 64;
+        openhttp_ws_t **list = (openhttp_ws_t **)realloc(_linux_ws_list, cap * sizeof(*list));
+        if (!list)
+        {
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket table");
+            return NULL;
+        }
+        _linux_ws_list = list;
+        _linux_ws_cap = cap;
+    }
+
+    openhttp_ws_t *ws = (openhttp_ws_t *)calloc(1, sizeof(openhttp_ws_t));
+    if (!ws)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket connection");
+        return NULL;
+    }
+
+    if (_openhttp_linux_write_callback(response) != OPENHTTP_SUCCESS)
+    {
+        free(ws);
+        return NULL;
+    }
+
+    // Edge-triggered EPOLLOUT only fires once the socket becomes writable again, so it can stay registered.
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.fd = client_fd;
+    if (epoll_ctl(_linux_epoll_fd, EPOLL_CTL_MOD, client_fd, &event) == -1)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to modify client socket in epoll instance");
+        free(ws);
+        return NULL;
+    }
+
+    ws->_fd = client_fd;
+    ws->_callback = callback;
+    ws->_index = _linux_ws_count;
+    _linux_ws_list[_linux_ws_count++] = ws;
+    _linux_ws_by_fd[client_fd] = ws;
+    return ws;
+}
+
+int _openhttp_linux_websocket_send_frame(openhttp_ws_t *ws, openhttp_ws_frame_t *frame)
+{
+    size_t offset = 0;
+
+    if (ws->_out_count == 0)
+    {
+        ssize_t sent = send(ws->_fd, frame->_data, frame->_length, MSG_NOSIGNAL);
+        if (sent == (ssize_t)frame->_length)
+        {
+            if (ws->_closing)
+            {
+                _linux_ws_kill(ws);
+            }
+            return OPENHTTP_SUCCESS;
+        }
+
+        if (sent == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                _linux_ws_kill(ws);
+                _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to write frame to WebSocket connection");
+                return OPENHTTP_SYSTEM_ERROR;
+            }
+            sent = 0;
+        }
+
+        offset = sent;
+    }
+
+    if (ws->_out_count == OPENHTTP_WS_MAX_QUEUE)
+    {
+        _linux_ws_kill(ws);
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "WebSocket connection is too slow, dropping it");
         return OPENHTTP_SYSTEM_ERROR;
     }
 
+    if (ws->_out_count == ws->_out_cap)
+    {
+        size_t cap = ws->_out_cap ? ws->_out_cap * 2 : 8;
+        openhttp_ws_frame_t **out = (openhttp_ws_frame_t **)malloc(cap * sizeof(*out));
+        if (!out)
+        {
+            _linux_ws_kill(ws);
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket queue");
+            return OPENHTTP_SYSTEM_ERROR;
+        }
+
+        for (size_t i = 0; i < ws->_out_count; i++)
+        {
+            out[i] = ws->_out[(ws->_out_head + i) % ws->_out_cap];
+        }
+
+        free(ws->_out);
+        ws->_out = out;
+        ws->_out_cap = cap;
+        ws->_out_head = 0;
+    }
+
+    if (ws->_out_count == 0)
+    {
+        ws->_out_offset = offset;
+    }
+
+    __atomic_add_fetch(&frame->_refcount, 1, __ATOMIC_RELAXED);
+    ws->_out[(ws->_out_head + ws->_out_count) % ws->_out_cap] = frame;
+    ws->_out_count++;
     return OPENHTTP_SUCCESS;
 }
 
+int _openhttp_linux_websocket_broadcast(openhttp_ws_frame_t *frame)
+{
+    if (_linux_loop)
+    {
+        for (size_t i = 0; i < _linux_ws_count; i++)
+        {
+            openhttp_ws_t *ws = _linux_ws_list[i];
+            if (!ws->_dead && !ws->_closing)
+            {
+                _openhttp_linux_websocket_send_frame(ws, frame);
+            }
+        }
+
+        return OPENHTTP_SUCCESS;
+    }
+
+    // Off the loop threads the frame is handed to every running loop, which sends it once woken up.
+    pthread_mutex_lock(&_linux_loops_lock);
+    if (!_linux_loops)
+    {
+        pthread_mutex_unlock(&_linux_loops_lock);
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "No event loop is running to broadcast on");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    int result = OPENHTTP_SUCCESS;
+    for (_linux_loop_t *loop = _linux_loops; loop; loop = loop->next)
+    {
+        if (loop->pending_count == loop->pending_cap)
+        {
+            size_t cap = loop->pending_cap ? loop->pending_cap * 2 : 16;
+            openhttp_ws_frame_t **pending = (openhttp_ws_frame_t **)realloc(loop->pending, cap * sizeof(*pending));
+            if (!pending)
+            {
+                _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for queued broadcast");
+                result = OPENHTTP_SYSTEM_ERROR;
+                continue;
+            }
+            loop->pending = pending;
+            loop->pending_cap = cap;
+        }
+
+        __atomic_add_fetch(&frame->_refcount, 1, __ATOMIC_RELAXED);
+        loop->pending[loop->pending_count++] = frame;
+
+        uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        {
+            _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to wake up event loop");
+            result = OPENHTTP_SYSTEM_ERROR;
+        }
+    }
+    pthread_mutex_unlock(&_linux_loops_lock);
+
+    return result;
+}
+
 #endif // __linux__
 
 /*
@@ -45,6 +45,39 @@ int openhttp_write(const char *data)
     return OPENHTTP_SYSTEM_PREFIX(write_callback)(data);
 }
 
+int openhttp_set_limits(const openhttp_limits_t *limits)
+{
+    if (!limits)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid admission control limits.");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    return OPENHTTP_SYSTEM_PREFIX(set_limits)(limits);
+}
+
+int openhttp_get_limits(openhttp_limits_t *limits)
+{
+    if (!limits)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid admission control limits.");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    return OPENHTTP_SYSTEM_PREFIX(get_limits)(limits);
+}
+
+int openhttp_get_stats(openhttp_stats_t *stats)
+{
+    if (!stats)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid admission control statistics.");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    return OPENHTTP_SYSTEM_PREFIX(get_stats)(stats);
+}
+
 char *openhttp_generate_response(const char *code, const char *file_path)
 {
     if (!code || !file_path)
@@ -0,0 +1,670 @@
+/*
+ * websocket.c
+ *
+ * Name: openhttp
+ * Description: Open-source HTTP server written in pure C
+ * Version: 1.0.0
+ *
+ * Author: Kevin Alavik <kevin@alavik.se>
+ * Year: 2024
+ *
+ * This file contains the WebSocket (RFC 6455) protocol code for the OpenHTTP server.
+ *
+ * Contributors:
+ *  - Kevin Alavik <kevin@alavik.se>
+ */
+
+#include <openhttp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// ------- HANDSHAKE ------------------
+static uint32_t _ws_rol(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void _ws_sha1(const uint8_t *data, size_t length, uint8_t digest[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t block[64];
+    uint64_t bits = (uint64_t)length * 8;
+    size_t total = ((length + 8) / 64 + 1) * 64;
+
+    for (size_t offset = 0; offset < total; offset += 64)
+    {
+        for (size_t i = 0; i < 64; i++)
+        {
+            size_t pos = offset + i;
+            if (pos < length)
+                block[i] = data[pos];
+            else if (pos == length)
+                block[i] = 0x80;
+            else if (pos >= total - 8)
+                block[i] = (uint8_t)(bits >> ((total - 1 - pos) * 8));
+            else
+                block[i] = 0;
+        }
+
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+                   (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+        }
+        for (int i = 16; i < 80; i++)
+        {
+            w[i] = _ws_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t temp = _ws_rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = _ws_rol(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for (int i = 0; i < 20; i++)
+    {
+        digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
+
+static void _ws_base64(const uint8_t *data, size_t length, char *out)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t i = 0;
+    for (; i + 2 < length; i += 3)
+    {
+        uint32_t v = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+        *out++ = table[(v >> 18) & 0x3F];
+        *out++ = table[(v >> 12) & 0x3F];
+        *out++ = table[(v >> 6) & 0x3F];
+        *out++ = table[v & 0x3F];
+    }
+
+    if (i < length)
+    {
+        uint32_t v = (uint32_t)data[i] << 16 | (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0);
+        *out++ = table[(v >> 18) & 0x3F];
+        *out++ = table[(v >> 12) & 0x3F];
+        *out++ = i + 1 < length ? table[(v >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+
+    *out = '\0';
+}
+
+// Finds a header value in the request, the name is matched case-insensitively.
+static const char *_ws_header(const char *request, const char *name, size_t *length)
+{
+    size_t name_len = strlen(name);
+    const char *line = strstr(request, "\r\n");
+
+    while (line && line[2] != '\0' && line[2] != '\r')
+    {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (!end)
+            end = line + strlen(line);
+
+        size_t i = 0;
+        while (i < name_len && line + i < end && tolower((unsigned char)line[i]) == tolower((unsigned char)name[i]))
+            i++;
+
+        if (i == name_len && line[i] == ':')
+        {
+            const char *value = line + i + 1;
+            while (value < end && (*value == ' ' || *value == '\t'))
+                value++;
+
+            const char *value_end = end;
+            while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+                value_end--;
+
+            *length = value_end - value;
+            return value;
+        }
+
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+static int _ws_contains_token(const char *value, size_t length, const char *token)
+{
+    size_t token_len = strlen(token);
+    for (size_t i = 0; i + token_len <= length; i++)
+    {
+        size_t j = 0;
+        while (j < token_len && tolower((unsigned char)value[i + j]) == token[j])
+            j++;
+
+        if (j == token_len)
+            return 1;
+    }
+
+    return 0;
+}
+
+openhttp_ws_t *openhttp_websocket_upgrade(const char *request, _openhttp_ws_callback callback)
+{
+    if (!request || !callback || strncmp(request, "GET ", 4) != 0)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid WebSocket handshake request.");
+        return NULL;
+    }
+
+    // Switching protocols on a truncated request would leave header bytes behind to be parsed as frames.
+    if (!strstr(request, "\r\n\r\n"))
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "WebSocket handshake request is incomplete or too large.");
+        return NULL;
+    }
+
+    size_t upgrade_len, connection_len, version_len, key_len;
+    const char *upgrade = _ws_header(request, "Upgrade", &upgrade_len);
+    const char *connection = _ws_header(request, "Connection", &connection_len);
+    const char *version = _ws_header(request, "Sec-WebSocket-Version", &version_len);
+    const char *key = _ws_header(request, "Sec-WebSocket-Key", &key_len);
+
+    if (!upgrade || !_ws_contains_token(upgrade, upgrade_len, "websocket") ||
+        !connection || !_ws_contains_token(connection, connection_len, "upgrade"))
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Request is not a WebSocket upgrade.");
+        return NULL;
+    }
+
+    if (!version || version_len != 2 || strncmp(version, "13", 2) != 0 || !key || key_len != 24)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Unsupported WebSocket version or invalid key.");
+        return NULL;
+    }
+
+    uint8_t accept_src[24 + sizeof(WS_GUID) - 1];
+    memcpy(accept_src, key, 24);
+    memcpy(accept_src + 24, WS_GUID, sizeof(WS_GUID) - 1);
+
+    uint8_t digest[20];
+    char accept[29];
+    _ws_sha1(accept_src, sizeof(accept_src), digest);
+    _ws_base64(digest, sizeof(digest), accept);
+
+    char response[160];
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 101 Switching Protocols\r\n"
+             "Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "Sec-WebSocket-Accept: %s\r\n"
+             "\r\n",
+             accept);
+
+    return OPENHTTP_SYSTEM_PREFIX(websocket_upgrade)(response, callback);
+}
+
+// ------- FRAMES ---------------------
+openhttp_ws_frame_t *openhttp_websocket_frame(int opcode, const char *data, size_t length)
+{
+    if ((opcode & ~0x0F) || (length && !data))
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid WebSocket frame.");
+        return NULL;
+    }
+
+    size_t header_len = length < 126 ? 2 : length <= 0xFFFF ? 4 : 10;
+    openhttp_ws_frame_t *frame = (openhttp_ws_frame_t *)malloc(sizeof(openhttp_ws_frame_t) + header_len + length);
+    if (!frame)
+    {
+        _openhttp_raise_error(OPENHTTP_SYSTEM_ERROR, "Failed to allocate memory for WebSocket frame.");
+        return NULL;
+    }
+
+    frame->_refcount = 1;
+    frame->_length = header_len + length;
+
+    // Server to client frames are never masked.
+    uint8_t *header = frame->_data;
+    header[0] = 0x80 | (uint8_t)opcode;
+    if (header_len == 2)
+    {
+        header[1] = (uint8_t)length;
+    }
+    else if (header_len == 4)
+    {
+        header[1] = 126;
+        header[2] = (uint8_t)(length >> 8);
+        header[3] = (uint8_t)length;
+    }
+    else
+    {
+        header[1] = 127;
+        for (int i = 0; i < 8; i++)
+        {
+            header[2 + i] = (uint8_t)((uint64_t)length >> (56 - i * 8));
+        }
+    }
+
+    if (length)
+    {
+        memcpy(frame->_data + header_len, data, length);
+    }
+
+    return frame;
+}
+
+void openhttp_websocket_frame_release(openhttp_ws_frame_t *frame)
+{
+    if (frame && __atomic_sub_fetch(&frame->_refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(frame);
+    }
+}
+
+int openhttp_websocket_send_frame(openhttp_ws_t *ws, openhttp_ws_frame_t *frame)
+{
+    if (!ws || !frame)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid WebSocket connection or frame.");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    if (ws->_closing || ws->_dead)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "WebSocket connection is closing.");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    return OPENHTTP_SYSTEM_PREFIX(websocket_send_frame)(ws, frame);
+}
+
+int openhttp_websocket_send(openhttp_ws_t *ws, int opcode, const char *data, size_t length)
+{
+    openhttp_ws_frame_t *frame = openhttp_websocket_frame(opcode, data, length);
+    if (!frame)
+    {
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    int result = openhttp_websocket_send_frame(ws, frame);
+    openhttp_websocket_frame_release(frame);
+    return result;
+}
+
+int openhttp_websocket_broadcast(int opcode, const char *data, size_t length)
+{
+    openhttp_ws_frame_t *frame = openhttp_websocket_frame(opcode, data, length);
+    if (!frame)
+    {
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    int result = OPENHTTP_SYSTEM_PREFIX(websocket_broadcast)(frame);
+    openhttp_websocket_frame_release(frame);
+    return result;
+}
+
+int openhttp_websocket_close(openhttp_ws_t *ws, uint16_t code)
+{
+    if (!ws)
+    {
+        _openhttp_raise_error(OPENHTTP_UNKNOWN_ERROR, "Invalid WebSocket connection.");
+        return OPENHTTP_UNKNOWN_ERROR;
+    }
+
+    if (ws->_closing || ws->_dead)
+    {
+        return OPENHTTP_SUCCESS;
+    }
+
+    char payload[2] = {(char)(code >> 8), (char)(code & 0xFF)};
+    openhttp_ws_frame_t *frame = openhttp_websocket_frame(OPENHTTP_WS_CLOSE, payload, code ? sizeof(payload) : 0);
+    if (!frame)
+    {
+        return OPENHTTP_SYSTEM_ERROR;
+    }
+
+    // Marked first so the connection is dropped as soon as the close frame has been written.
+    ws->_closing = 1;
+    int result = OPENHTTP_SYSTEM_PREFIX(websocket_send_frame)(ws, frame);
+    openhttp_websocket_frame_release(frame);
+    return result;
+}
+
+// ------- PARSER ---------------------
+void _openhttp_ws_unmask(uint8_t *data, size_t length, const uint8_t mask[4])
+{
+    uint32_t mask32;
+    memcpy(&mask32, mask, sizeof(mask32));
+
+    // Every step below consumes a multiple of 4 bytes, so the mask stays aligned with the payload.
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i mask256 = _mm256_set1_epi32((int)mask32);
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(v, mask256));
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i mask128 = _mm_set1_epi32((int)mask32);
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(v, mask128));
+    }
+#endif
+
+    uint64_t mask64 = (uint64_t)mask32 << 32 | mask32;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t v;
+        memcpy(&v, data + i, sizeof(v));
+        v ^= mask64;
+        memcpy(data + i, &v, sizeof(v));
+    }
+
+    for (; i < length; i++)
+    {
+        data[i] ^= mask[i & 3];
+    }
+}
+
+static int _ws_valid_utf8(const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        // Most text is plain ASCII, so skip over it a word at a time.
+        uint64_t word;
+        if (i + 8 <= length && (memcpy(&word, data + i, sizeof(word)), (word & 0x8080808080808080ULL) == 0))
+        {
+            i += 8;
+            continue;
+        }
+
+        uint8_t c = data[i];
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+
+        size_t extra;
+        uint32_t codepoint;
+        if ((c & 0xE0) == 0xC0)
+        {
+            extra = 1;
+            codepoint = c & 0x1F;
+        }
+        else if ((c & 0xF0) == 0xE0)
+        {
+            extra = 2;
+            codepoint = c & 0x0F;
+        }
+        else if ((c & 0xF8) == 0xF0)
+        {
+            extra = 3;
+            codepoint = c & 0x07;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (length - i <= extra)
+            return 0;
+
+        for (size_t k = 1; k <= extra; k++)
+        {
+            if ((data[i + k] & 0xC0) != 0x80)
+                return 0;
+            codepoint = codepoint << 6 | (data[i + k] & 0x3F);
+        }
+
+        // Reject overlong encodings, UTF-16 surrogates and anything past U+10FFFF.
+        if ((extra == 1 && codepoint < 0x80) || (extra == 2 && codepoint < 0x800) ||
+            (extra == 3 && codepoint < 0x10000) || codepoint > 0x10FFFF ||
+            (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+            return 0;
+
+        i += extra + 1;
+    }
+
+    return 1;
+}
+
+static int _ws_valid_close_code(uint16_t code)
+{
+    return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) || (code >= 3000 && code <= 4999);
+}
+
+static int _ws_append_message(openhttp_ws_t *ws, const uint8_t *data, size_t length)
+{
+    if (ws->_msg_len + length > OPENHTTP_WS_MAX_MESSAGE)
+    {
+        return 0;
+    }
+
+    if (ws->_msg_len + length > ws->_msg_cap)
+    {
+        size_t cap = ws->_msg_cap ? ws->_msg_cap : 4096;
+        while (cap < ws->_msg_len + length)
+            cap *= 2;
+
+        uint8_t *msg = (uint8_t *)realloc(ws->_msg, cap);
+        if (!msg)
+        {
+            return 0;
+        }
+
+        ws->_msg = msg;
+        ws->_msg_cap = cap;
+    }
+
+    memcpy(ws->_msg + ws->_msg_len, data, length);
+    ws->_msg_len += length;
+    return 1;
+}
+
+size_t _openhttp_ws_process(openhttp_ws_t *ws, uint8_t *data, size_t length)
+{
+    size_t pos = 0;
+
+    while (!ws->_closing && !ws->_dead)
+    {
+        uint8_t *frame = data + pos;
+        size_t avail = length - pos;
+        if (avail < 2)
+            break;
+
+        int fin = frame[0] & 0x80;
+        int opcode = frame[0] & 0x0F;
+        uint64_t payload_len = frame[1] & 0x7F;
+        size_t header_len = 2;
+
+        // No extensions are negotiated, and clients must always mask their frames.
+        if ((frame[0] & 0x70) || !(frame[1] & 0x80))
+        {
+            openhttp_websocket_close(ws, 1002);
+            break;
+        }
+
+        // Control frames are checked before their payload is waited for.
+        if ((opcode & 0x08) && (!fin || payload_len > 125 ||
+                                (opcode != OPENHTTP_WS_CLOSE && opcode != OPENHTTP_WS_PING && opcode != OPENHTTP_WS_PONG)))
+        {
+            openhttp_websocket_close(ws, 1002);
+            break;
+        }
+
+        if (payload_len == 126)
+        {
+            if (avail < 4)
+                break;
+            payload_len = (uint64_t)frame[2] << 8 | frame[3];
+            header_len = 4;
+        }
+        else if (payload_len == 127)
+        {
+            if (avail < 10)
+                break;
+            payload_len = 0;
+            for (int i = 0; i < 8; i++)
+                payload_len = payload_len << 8 | frame[2 + i];
+            header_len = 10;
+        }
+
+        if (payload_len > OPENHTTP_WS_MAX_MESSAGE)
+        {
+            openhttp_websocket_close(ws, 1009);
+            break;
+        }
+
+        if (avail < header_len + 4 + payload_len)
+            break;
+
+        uint8_t *payload = frame + header_len + 4;
+        _openhttp_ws_unmask(payload, (size_t)payload_len, frame + header_len);
+        pos += header_len + 4 + (size_t)payload_len;
+
+        if (opcode == OPENHTTP_WS_PING)
+        {
+            openhttp_websocket_send(ws, OPENHTTP_WS_PONG, (const char *)payload, (size_t)payload_len);
+            continue;
+        }
+        else if (opcode == OPENHTTP_WS_PONG)
+        {
+            continue;
+        }
+        else if (opcode == OPENHTTP_WS_CLOSE)
+        {
+            // A close payload is either empty or a valid status code followed by a UTF-8 reason.
+            uint16_t code = payload_len >= 2 ? (uint16_t)(payload[0] << 8 | payload[1]) : 1000;
+            if (payload_len == 1 || !_ws_valid_close_code(code))
+                code = 1002;
+            else if (payload_len > 2 && !_ws_valid_utf8(payload + 2, (size_t)payload_len - 2))
+                code = 1007;
+
+            openhttp_websocket_close(ws, code);
+            break;
+        }
+
+        int valid = opcode == OPENHTTP_WS_CONTINUATION
+                        ? ws->_msg_opcode != 0
+                        : (opcode == OPENHTTP_WS_TEXT || opcode == OPENHTTP_WS_BINARY) && ws->_msg_opcode == 0;
+        if (!valid)
+        {
+            openhttp_websocket_close(ws, 1002);
+            break;
+        }
+
+        if (fin && opcode != OPENHTTP_WS_CONTINUATION)
+        {
+            if (opcode == OPENHTTP_WS_TEXT && !_ws_valid_utf8(payload, (size_t)payload_len))
+            {
+                openhttp_websocket_close(ws, 1007);
+                break;
+            }
+
+            // Unfragmented messages are delivered straight from the receive buffer.
+            ws->_callback(ws, opcode, (const char *)payload, (size_t)payload_len);
+            continue;
+        }
+
+        if (opcode != OPENHTTP_WS_CONTINUATION)
+        {
+            ws->_msg_opcode = opcode;
+        }
+
+        if (!_ws_append_message(ws, payload, (size_t)payload_len))
+        {
+            openhttp_websocket_close(ws, 1009);
+            break;
+        }
+
+        if (fin)
+        {
+            if (ws->_msg_opcode == OPENHTTP_WS_TEXT && !_ws_valid_utf8(ws->_msg, ws->_msg_len))
+            {
+                openhttp_websocket_close(ws, 1007);
+                break;
+            }
+
+            ws->_callback(ws, ws->_msg_opcode, (const char *)ws->_msg, ws->_msg_len);
+            free(ws->_msg);
+            ws->_msg = NULL;
+            ws->_msg_opcode = 0;
+            ws->_msg_len = 0;
+            ws->_msg_cap = 0;
+        }
+    }
+
+    // Once closing, whatever the client sends is discarded.
+    return ws->_closing || ws->_dead ? length : pos;
+}
+
+/*
+ * License: MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * provided to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openhttp/openhttp.h>
+
+/*
+ * WebSocket broadcast fan-out benchmark.
+ *
+ * The server runs in a child process. The parent opens the given number of WebSocket
+ * connections over loopback, then one of them publishes a message which the server
+ * broadcasts to every connection. The time until all connections have received it is measured.
+ *
+ * Usage: ./bench [connections] [rounds] [payload size]
+ */
+
+#define BENCH_PORT 8081
+
+static int on_message(openhttp_ws_t *ws, int opcode, const char *data, size_t length)
+{
+    (void)ws;
+
+    if (opcode == OPENHTTP_WS_TEXT || opcode == OPENHTTP_WS_BINARY)
+    {
+        openhttp_websocket_broadcast(opcode, data, length);
+    }
+
+    return OPENHTTP_SUCCESS;
+}
+
+static int callback(openhttp_server_t *server, const char *request)
+{
+    (void)server;
+
+    if (!openhttp_websocket_upgrade(request, on_message))
+    {
+        openhttp_write("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+    }
+
+    return OPENHTTP_SUCCESS;
+}
+
+static void run_server(void)
+{
+    // Connecting thousands of clients in a burst is expected here, so don't shed them.
+    openhttp_limits_t limits;
+    openhttp_get_limits(&limits);
+    limits.max_lag_us = 0;
+    openhttp_set_limits(&limits);
+
+    openhttp_server_t server;
+    if (openhttp_server_spawn(&server, BENCH_PORT, callback) != OPENHTTP_SUCCESS)
+    {
+        fprintf(stderr, "Error: %s\n", openhttp_error());
+    }
+    _exit(1);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_client(void)
+{
+    const char *handshake = "GET / HTTP/1.1\r\n"
+                            "Host: 127.0.0.1\r\n"
+                            "Upgrade: websocket\r\n"
+                            "Connection: Upgrade\r\n"
+                            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                            "Sec-WebSocket-Version: 13\r\n"
+                            "\r\n";
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (write(fd, handshake, strlen(handshake)) != (ssize_t)strlen(handshake))
+    {
+        close(fd);
+        return -1;
+    }
+
+    char response[512];
+    size_t length = 0;
+    while (length < sizeof(response) - 1)
+    {
+        ssize_t bytes_read = read(fd, response + length, sizeof(response) - 1 - length);
+        if (bytes_read <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        length += bytes_read;
+        response[length] = '\0';
+        if (strstr(response, "\r\n\r\n"))
+            break;
+    }
+
+    if (strncmp(response, "HTTP/1.1 101", 12) != 0 ||
+        !strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="))
+    {
+        fprintf(stderr, "Error: unexpected handshake response:\n%s\n", response);
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    int connections = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 100;
+    size_t payload_len = argc > 3 ? (size_t)atoi(argv[3]) : 64;
+    if (connections < 1 || rounds < 1 || payload_len < 1 || payload_len > 125)
+    {
+        fprintf(stderr, "Usage: %s [connections] [rounds] [payload size (1-125)]\n", argv[0]);
+        return 1;
+    }
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < (rlim_t)connections + 64)
+    {
+        fprintf(stderr, "Error: file descriptor limit %lu is too low for %d connections\n",
+                (unsigned long)limit.rlim_cur, connections);
+        return 1;
+    }
+
+    pid_t server_pid = fork();
+    if (server_pid == 0)
+    {
+        run_server();
+    }
+
+    int *fds = (int *)malloc(connections * sizeof(int));
+    int epoll_fd = epoll_create1(0);
+    if (!fds || epoll_fd == -1)
+    {
+        fprintf(stderr, "Error: failed to set up clients\n");
+        kill(server_pid, SIGTERM);
+        return 1;
+    }
+
+    double start = now_seconds();
+    for (int i = 0; i < connections; i++)
+    {
+        fds[i] = connect_client();
+        for (int retry = 0; fds[i] == -1 && i == 0 && retry < 50; retry++)
+        {
+            usleep(20000);
+            fds[i] = connect_client();
+        }
+
+        if (fds[i] == -1)
+        {
+            fprintf(stderr, "Error: failed to open connection %d\n", i);
+            kill(server_pid, SIGTERM);
+            return 1;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fds[i];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event);
+    }
+    printf("Connected %d WebSocket clients in %.3f s\n", connections, now_seconds() - start);
+
+    // Client frames must be masked, an all-zero mask keeps the payload readable.
+    uint8_t publish[2 + 4 + 125] = {0x81, 0x80 | (uint8_t)payload_len};
+    memset(publish + 6, 'x', payload_len);
+    size_t publish_len = 6 + payload_len;
+
+    size_t frame_len = 2 + payload_len;
+    uint64_t expected = (uint64_t)connections * frame_len;
+    struct epoll_event *events = (struct epoll_event *)malloc(1024 * sizeof(struct epoll_event));
+    char buffer[65536];
+
+    double total = 0, worst = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        uint64_t received = 0;
+        double round_start = now_seconds();
+
+        if (write(fds[0], publish, publish_len) != (ssize_t)publish_len)
+        {
+            fprintf(stderr, "Error: failed to publish message\n");
+            kill(server_pid, SIGTERM);
+            return 1;
+        }
+
+        while (received < expected)
+        {
+            int nfd = epoll_wait(epoll_fd, events, 1024, 5000);
+            if (nfd <= 0)
+            {
+                fprintf(stderr, "Error: timed out after %llu of %llu bytes\n",
+                        (unsigned long long)received, (unsigned long long)expected);
+                kill(server_pid, SIGTERM);
+                return 1;
+            }
+
+            for (int i = 0; i < nfd; i++)
+            {
+                ssize_t bytes_read;
+                while ((bytes_read = read(events[i].data.fd, buffer, sizeof(buffer))) > 0)
+                {
+                    received += bytes_read;
+                }
+            }
+        }
+
+        double elapsed = now_seconds() - round_start;
+        total += elapsed;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+
+    printf("Broadcast %d x %zu byte messages to %d connections\n", rounds, payload_len, connections);
+    printf("  total     : %.3f s\n", total);
+    printf("  per round : %.3f ms avg, %.3f ms worst\n", total / rounds * 1e3, worst * 1e3);
+    printf("  fan-out   : %.0f deliveries/s\n", (double)connections * rounds / total);
+
+    // Closing from the client side leaves TIME_WAIT on the client ports, so the bench can be rerun right away.
+    for (int i = 0; i < connections; i++)
+    {
+        close(fds[i]);
+    }
+    usleep(200000);
+
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+    return 0;
+}
@@ -7,8 +7,8 @@ static volatile int running = 1;
 
 void handle_signal(int sig)
 {
+    // Stops the server loop, openhttp_server_spawn() returns and main() exits normally.
     openhttp_cleanup();
-    exit(0);
 }
 
 int callback(openhttp_server_t *server, const char *request)
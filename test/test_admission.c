@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <openhttp/openhttp.h>
+
+/*
+ * Admission control tests.
+ *
+ * Drives the per-client token bucket with a fixed clock: the burst a new client gets, refilling
+ * at the configured rate without losing fractions of a token to small steps, the cap at the
+ * burst size, and the Retry-After value of a rejected connection.
+ */
+
+// The loop never passes a zero timestamp, a bucket with one counts as unused.
+#define START_US 1000000ULL
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                          \
+    do                                                            \
+    {                                                             \
+        if (!(cond))                                              \
+        {                                                         \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);  \
+            fprintf(stderr, __VA_ARGS__);                         \
+            fprintf(stderr, "\n");                                \
+            failures++;                                           \
+        }                                                         \
+    } while (0)
+
+static void set_rate(uint32_t rate_per_sec, uint32_t rate_burst)
+{
+    openhttp_limits_t limits;
+    openhttp_get_limits(&limits);
+    limits.rate_per_sec = rate_per_sec;
+    limits.rate_burst = rate_burst;
+    openhttp_set_limits(&limits);
+}
+
+static int admit(uint32_t addr, uint64_t now, uint32_t *retry_after)
+{
+    *retry_after = 0;
+    return OPENHTTP_SYSTEM_PREFIX(rate_admit)(addr, now, retry_after);
+}
+
+static void test_burst(void)
+{
+    uint32_t retry_after;
+    set_rate(2, 3);
+
+    for (int i = 0; i < 3; i++)
+        CHECK(admit(1, START_US, &retry_after), "connection %d of the burst", i);
+
+    CHECK(!admit(1, START_US, &retry_after), "connection past the burst");
+    CHECK(retry_after == 1, "retry after %u s instead of 1 s", retry_after);
+
+    // Buckets are per address.
+    CHECK(admit(2, START_US, &retry_after), "other client during a burst");
+}
+
+static void test_refill(void)
+{
+    uint32_t retry_after;
+    set_rate(2, 3);
+
+    for (int i = 0; i < 3; i++)
+        admit(3, START_US, &retry_after);
+
+    // At 2 per second the next token is due after exactly 500 ms, a rejection rounds the wait up.
+    CHECK(!admit(3, START_US + 499999, &retry_after), "token before it is due");
+    CHECK(retry_after == 1, "retry after %u s right before a refill", retry_after);
+    CHECK(admit(3, START_US + 500000, &retry_after), "token when it is due");
+    CHECK(!admit(3, START_US + 500000, &retry_after), "second token at the same time");
+}
+
+static void test_small_steps(void)
+{
+    uint32_t retry_after;
+    set_rate(3, 3);
+
+    uint64_t now = START_US;
+    for (int i = 0; i < 3; i++)
+        admit(4, now, &retry_after);
+
+    // A rejected attempt every millisecond must not discard the fraction of a token earned since the last.
+    int admitted = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        now += 1000;
+        admitted += admit(4, now, &retry_after);
+    }
+    CHECK(admitted == 3, "%d connections in a second of 1 ms steps at 3 per second", admitted);
+}
+
+static void test_burst_cap(void)
+{
+    uint32_t retry_after;
+    set_rate(2, 0);
+
+    for (int i = 0; i < 2; i++)
+        admit(5, START_US, &retry_after);
+
+    // A burst of 0 defaults to the rate, however long the client was idle.
+    int admitted = 0;
+    while (admit(5, START_US + 100 * 1000000ULL, &retry_after))
+        admitted++;
+    CHECK(admitted == 2, "%d connections after a long idle period, burst is 2", admitted);
+}
+
+int main(void)
+{
+    test_burst();
+    test_refill();
+    test_small_steps();
+    test_burst_cap();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("All admission tests passed\n");
+    return 0;
+}
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <openhttp/openhttp.h>
+
+/*
+ * WebSocket frame parser tests.
+ *
+ * Feeds masked frames to _openhttp_ws_process() the way the event loop does, split at every
+ * byte boundary, and checks the unmasking routine against a plain byte loop. Frames the parser
+ * sends back (pongs, close frames) are read from the other end of a socket pair.
+ */
+
+#define MAX_MESSAGES 8
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                          \
+    do                                                            \
+    {                                                             \
+        if (!(cond))                                              \
+        {                                                         \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);  \
+            fprintf(stderr, __VA_ARGS__);                         \
+            fprintf(stderr, "\n");                                \
+            failures++;                                           \
+        }                                                         \
+    } while (0)
+
+typedef struct message
+{
+    int opcode;
+    size_t length;
+    char *data;
+} message_t;
+
+static message_t received[MAX_MESSAGES];
+static int received_count = 0;
+
+static const uint8_t test_mask[4] = {0x37, 0xFA, 0x21, 0x3D};
+
+static int on_message(openhttp_ws_t *ws, int opcode, const char *data, size_t length)
+{
+    (void)ws;
+
+    if (received_count < MAX_MESSAGES)
+    {
+        received[received_count].opcode = opcode;
+        received[received_count].length = length;
+        received[received_count].data = (char *)malloc(length + 1);
+        memcpy(received[received_count].data, data, length);
+        received_count++;
+    }
+
+    return OPENHTTP_SUCCESS;
+}
+
+static void reset_received(void)
+{
+    for (int i = 0; i < received_count; i++)
+    {
+        free(received[i].data);
+    }
+    received_count = 0;
+}
+
+static size_t encode_frame(uint8_t *out, int fin, int opcode, const uint8_t *payload, size_t length)
+{
+    size_t pos = 0;
+    out[pos++] = (fin ? 0x80 : 0) | opcode;
+
+    if (length < 126)
+    {
+        out[pos++] = 0x80 | (uint8_t)length;
+    }
+    else if (length <= 0xFFFF)
+    {
+        out[pos++] = 0x80 | 126;
+        out[pos++] = (uint8_t)(length >> 8);
+        out[pos++] = (uint8_t)length;
+    }
+    else
+    {
+        out[pos++] = 0x80 | 127;
+        for (int i = 0; i < 8; i++)
+            out[pos++] = (uint8_t)((uint64_t)length >> (56 - i * 8));
+    }
+
+    memcpy(out + pos, test_mask, 4);
+    pos += 4;
+
+    for (size_t i = 0; i < length; i++)
+        out[pos + i] = payload[i] ^ test_mask[i & 3];
+
+    return pos + length;
+}
+
+// Same bookkeeping as the event loop: whatever is not consumed is kept and prepended to the next read.
+static int feed_split(openhttp_ws_t *ws, const uint8_t *stream, size_t length, size_t split)
+{
+    uint8_t *buffer = (uint8_t *)malloc(length);
+    memcpy(buffer, stream, length);
+
+    size_t consumed = _openhttp_ws_process(ws, buffer, split);
+    if (consumed > split)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    memmove(buffer, buffer + consumed, length - consumed);
+    size_t rest = length - consumed;
+    int ok = _openhttp_ws_process(ws, buffer, rest) == rest;
+
+    free(buffer);
+    return ok;
+}
+
+static openhttp_ws_t *new_ws(int fd)
+{
+    openhttp_ws_t *ws = (openhttp_ws_t *)calloc(1, sizeof(openhttp_ws_t));
+    ws->_fd = fd;
+    ws->_callback = on_message;
+    return ws;
+}
+
+static void free_ws(openhttp_ws_t *ws)
+{
+    for (size_t i = 0; i < ws->_out_count; i++)
+        openhttp_websocket_frame_release(ws->_out[(ws->_out_head + i) % ws->_out_cap]);
+    free(ws->_out);
+    free(ws->_msg);
+    free(ws);
+}
+
+static size_t read_pending(int fd, uint8_t *out, size_t size)
+{
+    ssize_t length = recv(fd, out, size, MSG_DONTWAIT);
+    return length > 0 ? (size_t)length : 0;
+}
+
+static void test_unmask(void)
+{
+    uint8_t data[80 + 1], expected[80 + 1];
+
+    for (size_t offset = 0; offset < 2; offset++)
+    {
+        for (size_t length = 0; length <= 70; length++)
+        {
+            for (size_t i = 0; i < length; i++)
+                data[offset + i] = expected[i] = (uint8_t)(i * 31 + 7);
+            for (size_t i = 0; i < length; i++)
+                expected[i] ^= test_mask[i & 3];
+
+            _openhttp_ws_unmask(data + offset, length, test_mask);
+            CHECK(memcmp(data + offset, expected, length) == 0, "unmask length %zu offset %zu", length, offset);
+        }
+    }
+}
+
+static void test_split_stream(int sv[2])
+{
+    uint8_t binary[200];
+    for (size_t i = 0; i < sizeof(binary); i++)
+        binary[i] = (uint8_t)i;
+
+    uint8_t stream[512];
+    size_t length = 0;
+    length += encode_frame(stream + length, 1, OPENHTTP_WS_TEXT, (const uint8_t *)"Hello", 5);
+    length += encode_frame(stream + length, 1, OPENHTTP_WS_BINARY, binary, sizeof(binary));
+    length += encode_frame(stream + length, 0, OPENHTTP_WS_TEXT, (const uint8_t *)"frag", 4);
+    length += encode_frame(stream + length, 1, OPENHTTP_WS_PING, (const uint8_t *)"p", 1);
+    length += encode_frame(stream + length, 0, OPENHTTP_WS_CONTINUATION, (const uint8_t *)"men", 3);
+    length += encode_frame(stream + length, 1, OPENHTTP_WS_CONTINUATION, (const uint8_t *)"ted", 3);
+
+    for (size_t split = 0; split <= length; split++)
+    {
+        openhttp_ws_t *ws = new_ws(sv[0]);
+        reset_received();
+
+        CHECK(feed_split(ws, stream, length, split), "stream not fully consumed at split %zu", split);
+        CHECK(received_count == 3, "got %d messages at split %zu", received_count, split);
+        if (received_count == 3)
+        {
+            CHECK(received[0].opcode == OPENHTTP_WS_TEXT && received[0].length == 5 &&
+                      memcmp(received[0].data, "Hello", 5) == 0,
+                  "text message at split %zu", split);
+            CHECK(received[1].opcode == OPENHTTP_WS_BINARY && received[1].length == sizeof(binary) &&
+                      memcmp(received[1].data, binary, sizeof(binary)) == 0,
+                  "16-bit length message at split %zu", split);
+            CHECK(received[2].opcode == OPENHTTP_WS_TEXT && received[2].length == 10 &&
+                      memcmp(received[2].data, "fragmented", 10) == 0,
+                  "fragmented message at split %zu", split);
+        }
+
+        uint8_t pong[16];
+        size_t pong_len = read_pending(sv[1], pong, sizeof(pong));
+        CHECK(pong_len == 3 && pong[0] == 0x8A && pong[1] == 1 && pong[2] == 'p', "pong at split %zu", split);
+
+        free_ws(ws);
+    }
+}
+
+static void test_long_frame(int sv[2])
+{
+    size_t payload_len = 70000;
+    uint8_t *payload = (uint8_t *)malloc(payload_len);
+    uint8_t *stream = (uint8_t *)malloc(payload_len + 14);
+    for (size_t i = 0; i < payload_len; i++)
+        payload[i] = (uint8_t)(i * 13);
+
+    size_t length = encode_frame(stream, 1, OPENHTTP_WS_BINARY, payload, payload_len);
+
+    // Every split inside the header, then a spread through the payload.
+    for (size_t split = 0; split <= length; split = split < 32 ? split + 1 : split + 997)
+    {
+        openhttp_ws_t *ws = new_ws(sv[0]);
+        reset_received();
+
+        CHECK(feed_split(ws, stream, length, split), "long frame not consumed at split %zu", split);
+        CHECK(received_count == 1 && received[0].length == payload_len &&
+                  memcmp(received[0].data, payload, payload_len) == 0,
+              "64-bit length message at split %zu", split);
+
+        free_ws(ws);
+    }
+
+    free(payload);
+    free(stream);
+}
+
+static void expect_close(int sv[2], const uint8_t *stream, size_t length, uint16_t code, const char *what)
+{
+    openhttp_ws_t *ws = new_ws(sv[0]);
+    reset_received();
+
+    uint8_t *buffer = (uint8_t *)malloc(length);
+    memcpy(buffer, stream, length);
+    _openhttp_ws_process(ws, buffer, length);
+    free(buffer);
+
+    uint8_t reply[16];
+    size_t reply_len = read_pending(sv[1], reply, sizeof(reply));
+    CHECK(ws->_closing && reply_len == 4 && reply[0] == 0x88 && (reply[2] << 8 | reply[3]) == code,
+          "%s should close with %u", what, code);
+    CHECK(received_count == 0, "%s should not be delivered", what);
+
+    free_ws(ws);
+}
+
+static void test_protocol_errors(int sv[2])
+{
+    uint8_t stream[64];
+
+    expect_close(sv, stream, encode_frame(stream, 1, OPENHTTP_WS_TEXT, (const uint8_t *)"\xC0\xAF", 2), 1007,
+                 "overlong UTF-8");
+    expect_close(sv, stream, encode_frame(stream, 1, OPENHTTP_WS_CLOSE, (const uint8_t *)"\x03", 1), 1002,
+                 "1-byte close payload");
+    expect_close(sv, stream, encode_frame(stream, 1, OPENHTTP_WS_CLOSE, (const uint8_t *)"\x03\xED", 2), 1002,
+                 "close code 1005");
+    expect_close(sv, stream, encode_frame(stream, 1, OPENHTTP_WS_CONTINUATION, (const uint8_t *)"x", 1), 1002,
+                 "continuation without a message");
+
+    // A ping announcing a 16-bit length is rejected from its header alone.
+    uint8_t ping[2] = {0x89, 0x80 | 126};
+    expect_close(sv, ping, sizeof(ping), 1002, "oversized control frame");
+}
+
+int main(void)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    {
+        perror("socketpair");
+        return 1;
+    }
+
+    test_unmask();
+    test_split_stream(sv);
+    test_long_frame(sv);
+    test_protocol_errors(sv);
+    reset_received();
+
+    close(sv[0]);
+    close(sv[1]);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("All WebSocket tests passed\n");
+    return 0;
+}